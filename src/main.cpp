@@ -30,6 +30,54 @@ unsigned long lastDS18B20Read = 0;
 const unsigned long DS18B20_READ_INTERVAL = 1000; // Čítaj každú sekundu
 bool ds18b20Available = false;
 
+// Detekcia odberu teplej vody (derivácia tempDelta)
+// Prahy v stotinách (nastaviteľné cez sériovú linku, uložené v EEPROM)
+byte drawRateOn = 30;                 // 0.01 °C/s - nábeh derivácie, od ktorého ide o odber
+byte drawRateOff = 5;                 // 0.01 °C/s - pokles derivácie pre ukončenie odberu (hysterézia)
+byte drawFilterAlpha = 50;            // 0.01 - váha novej vzorky v exponenciálnom filtri derivácie
+const byte DRAW_RATE_ON_MAX = 200;
+const unsigned long DRAW_MAX_SAMPLE_GAP = 5000; // Dlhšia medzera (napr. menu) = nový začiatok
+float tempDeltaPrev = 0.0;
+float tempDeltaRate = 0.0;            // Filtrovaná derivácia tempDelta (°C/s)
+float tempInputPrev = 0.0;
+float tempInputRate = 0.0;            // Filtrovaná derivácia vstupnej teploty (°C/s)
+unsigned long lastDeltaSample = 0;
+bool deltaSampleValid = false;
+const unsigned long DRAW_MAX_HOLD = 600000; // Max. držanie ohrevu počas jedného odberu (10 min)
+bool drawActive = false;              // Práve prebieha odber
+unsigned long drawStartMillis = 0;
+
+// Softvérové hodiny odvodené z millis() (nastavujú sa cez sériovú linku)
+const unsigned long SECONDS_PER_WEEK = 604800UL;
+const int RTC_DRIFT_LIMIT = 9999;     // Max. korekcia driftu (ppm)
+unsigned long rtcWeekSeconds = 0;     // Sekundy od pondelka 00:00
+unsigned long rtcLastMillis = 0;
+long rtcMillisAccum = 0;              // Nazbierané ms do ďalšej sekundy
+long rtcDriftAccum = 0;               // Zvyšok korekcie driftu (ppm * ms)
+int rtcDriftPpm = 0;                  // + = millis() meškajú, hodiny sa zrýchlia
+bool rtcSet = false;                  // Hodiny sú platné až po nastavení času
+
+// Naučený profil odberu (24 hodín x 7 dní)
+const int DEMAND_SLOTS = 168;
+const byte DEMAND_DRAW_WEIGHT = 32;   // Príspevok jedného odberu k hodnote slotu
+const byte DEMAND_PREHEAT_LEVEL = 64; // Od tejto hodnoty sa v slote očakáva odber
+const byte DEMAND_QUIET_LEVEL = 8;    // Pod touto hodnotou je slot tichý
+const byte DEMAND_UNVISITED = 0;      // Slot ešte nemá históriu (naučené sloty majú aspoň 1)
+const unsigned long PREHEAT_LEAD_SECONDS = 1800; // Predohrev 30 minút pred očakávaným odberom
+const int QUIET_SETBACK = 10;         // °C - zníženie cieľovej teploty v tichých obdobiach
+byte demandHistogram[DEMAND_SLOTS];
+int demandSlot = -1;                  // Slot, v ktorom sa práve počítajú odbery
+byte demandSlotDraws = 0;
+bool demandSlotPartial = false;       // Slot nebol sledovaný celý (po nastavení času) - nezapíše sa
+const int PREHEAT_HYSTERESIS = 2;     // °C - predohrev sa znova zapne až pod cieľ mínus hysterézia
+int scheduledDestTemperature = 50;    // Cieľová teplota upravená podľa profilu
+bool preheatActive = false;
+bool preheatHeating = false;          // Predohrev práve drží relé (s hysteréziou)
+
+// Sériové príkazy
+char serialBuffer[24];
+byte serialLength = 0;
+
 // EEPROM adresy pre ukladanie nastavení
 const int EEPROM_ADDR_OFF = 0;    // Adresa pre OFF interval (2 bajty)
 const int EEPROM_ADDR_ON = 2;     // Adresa pre ON interval (2 bajty)
@@ -38,7 +86,12 @@ const int EEPROM_ADDR_MODE = 5;   // Adresa pre režim (1 bajt)
 const int EEPROM_ADDR_DEST_TEMP = 6; // Adresa pre cieľovú teplotu (2 bajty)
 const int EEPROM_ADDR_SIMULATION = 8; // Adresa pre simulačný režim (1 bajt)
 const int EEPROM_ADDR_EMERGENCY_TIME = 9; // Adresa pre emergency time on (2 bajty)
+const int EEPROM_ADDR_DRIFT = 11;     // Adresa pre korekciu driftu hodín (2 bajty)
+const int EEPROM_ADDR_DEMAND_MAGIC = 13; // Magic byte pre profil odberu
+const int EEPROM_ADDR_DRAW = 14;      // Prahy detekcie odberu (3 bajty: ON, OFF, alfa)
+const int EEPROM_ADDR_DEMAND = 17;    // Profil odberu (168 bajtov, 17-184)
 const byte EEPROM_MAGIC = 0xAB;   // Magic hodnota
+const byte EEPROM_DEMAND_MAGIC = 0xD7; // Magic hodnota profilu odberu
 
 // Režimy ovládania
 enum ControlMode { MANUAL, AUTOMATIC };
@@ -123,6 +176,58 @@ void initDS18B20() {
   }
 }
 
+// Inkrementálna derivácia tempDelta - pri odbere sa vstup prudko ochladí a delta rastie.
+// Delta rastie aj pri vlastnom ohreve (výstup sa zohrieva), preto odber platí len vtedy,
+// keď aspoň polovicu nárastu delty spôsobuje klesajúca vstupná teplota.
+void updateDrawDetector(unsigned long sampleMillis) {
+  unsigned long gap = sampleMillis - lastDeltaSample;
+  lastDeltaSample = sampleMillis;
+  
+  // Počas emergency režimu sa detekcia ignoruje (relé je zapnuté, výstup sa zohrieva)
+  if (emergencyActive || !deltaSampleValid || gap == 0 || gap > DRAW_MAX_SAMPLE_GAP) {
+    tempDeltaPrev = tempDelta;
+    tempDeltaRate = 0.0;
+    tempInputPrev = tempInput;
+    tempInputRate = 0.0;
+    deltaSampleValid = true;
+    drawActive = false;
+    return;
+  }
+  
+  float rate = (tempDelta - tempDeltaPrev) * 1000.0 / gap;
+  tempDeltaPrev = tempDelta;
+  tempDeltaRate += drawFilterAlpha / 100.0 * (rate - tempDeltaRate);
+  
+  float inputRate = (tempInput - tempInputPrev) * 1000.0 / gap;
+  tempInputPrev = tempInput;
+  tempInputRate += drawFilterAlpha / 100.0 * (inputRate - tempInputRate);
+  bool inletCooling = -2 * tempInputRate >= tempDeltaRate;
+  
+  if (!drawActive && tempDeltaRate * 100 >= drawRateOn && inletCooling) {
+    drawActive = true;
+    drawStartMillis = sampleMillis;
+    // Do profilu len odbery zo stavu OFF - pri zapnutom relé môže ísť o vlastný ohrev
+    if (rtcSet && !relayState && demandSlotDraws < 255) demandSlotDraws++;
+    Serial.print(F("Odber detekovany, dDelta/dt: "));
+    Serial.print(tempDeltaRate, 2);
+    Serial.println(F(" C/s"));
+  } else if (drawActive && (tempDeltaRate * 100 <= drawRateOff || tempInputRate >= 0)) {
+    drawActive = false;
+    Serial.println(F("Odber ukonceny"));
+  }
+}
+
+// Relé drží ON počas odberu (bez čerstvých vzoriek alebo po DRAW_MAX_HOLD sa nedrží)
+// a počas predohrevu; v automatickom režime len kým výstup nedosiahne plánovanú teplotu
+bool heatHoldRequested() {
+  unsigned long currentMillis = millis();
+  bool setpointReached = currentMode == AUTOMATIC && tempOutput >= scheduledDestTemperature;
+  bool drawHold = drawActive && !setpointReached &&
+                  currentMillis - lastDeltaSample <= DRAW_MAX_SAMPLE_GAP &&
+                  currentMillis - drawStartMillis < DRAW_MAX_HOLD;
+  return drawHold || preheatHeating;
+}
+
 void readDS18B20() {
   if (!ds18b20Available) return;
   
@@ -139,6 +244,7 @@ void readDS18B20() {
       tempInput = tIn;
       tempOutput = tOut;
       tempDelta = tempOutput - tempInput;
+      updateDrawDetector(currentMillis);
     }
   }
 }
@@ -159,6 +265,23 @@ void saveToEEPROM() {
   EEPROM.write(EEPROM_ADDR_MAGIC, EEPROM_MAGIC);
 }
 
+// Prahy odberu sa nastavujú cez sériovú linku - zapisujú sa samostatne, aby sa neuložili úpravy z menu
+void saveDrawSettingsToEEPROM() {
+  EEPROM.update(EEPROM_ADDR_DRAW, drawRateOn);
+  EEPROM.update(EEPROM_ADDR_DRAW + 1, drawRateOff);
+  EEPROM.update(EEPROM_ADDR_DRAW + 2, drawFilterAlpha);
+}
+
+// Drift sa nastavuje cez sériovú linku - zapisuje sa samostatne ako prahy odberu
+void saveDriftToEEPROM() {
+  EEPROM.update(EEPROM_ADDR_DRIFT, rtcDriftPpm & 0xFF);
+  EEPROM.update(EEPROM_ADDR_DRIFT + 1, (rtcDriftPpm >> 8) & 0xFF);
+}
+
+bool drawSettingsValid(long on, long off, long alpha) {
+  return on >= 1 && on <= DRAW_RATE_ON_MAX && off >= 0 && off < on && alpha >= 1 && alpha <= 100;
+}
+
 void loadFromEEPROM() {
   byte magic = EEPROM.read(EEPROM_ADDR_MAGIC);
   
@@ -189,10 +312,257 @@ void loadFromEEPROM() {
   highByte = EEPROM.read(EEPROM_ADDR_EMERGENCY_TIME + 1);
   emergencyTimeOn = (highByte << 8) | lowByte;
   
+  lowByte = EEPROM.read(EEPROM_ADDR_DRIFT);
+  highByte = EEPROM.read(EEPROM_ADDR_DRIFT + 1);
+  rtcDriftPpm = (int16_t)((highByte << 8) | lowByte);
+  
+  byte rateOn = EEPROM.read(EEPROM_ADDR_DRAW);
+  byte rateOff = EEPROM.read(EEPROM_ADDR_DRAW + 1);
+  byte alpha = EEPROM.read(EEPROM_ADDR_DRAW + 2);
+  if (drawSettingsValid(rateOn, rateOff, alpha)) {
+    drawRateOn = rateOn;
+    drawRateOff = rateOff;
+    drawFilterAlpha = alpha;
+  }
+  
   if (offIntervalSeconds < 1 || offIntervalSeconds > 999) offIntervalSeconds = 5;
   if (onIntervalSeconds < 1 || onIntervalSeconds > 999) onIntervalSeconds = 1;
   if (destinationTemperature < 1 || destinationTemperature > 99) destinationTemperature = 50;
   if (emergencyTimeOn < 1 || emergencyTimeOn > 999) emergencyTimeOn = 10;
+  if (rtcDriftPpm < -RTC_DRIFT_LIMIT || rtcDriftPpm > RTC_DRIFT_LIMIT) rtcDriftPpm = 0;
+}
+
+void loadDemandProfile() {
+  // Prvé spustenie s profilom: vymaž histogram aj korekciu driftu (adresy boli doteraz nepoužité)
+  if (EEPROM.read(EEPROM_ADDR_DEMAND_MAGIC) != EEPROM_DEMAND_MAGIC) {
+    for (int i = 0; i < DEMAND_SLOTS; i++) {
+      demandHistogram[i] = 0;
+      EEPROM.update(EEPROM_ADDR_DEMAND + i, 0);
+    }
+    rtcDriftPpm = 0;
+    saveDriftToEEPROM();
+    EEPROM.write(EEPROM_ADDR_DEMAND_MAGIC, EEPROM_DEMAND_MAGIC);
+    return;
+  }
+  
+  for (int i = 0; i < DEMAND_SLOTS; i++) {
+    demandHistogram[i] = EEPROM.read(EEPROM_ADDR_DEMAND + i);
+  }
+}
+
+// ========== Softvérové hodiny ========== 
+
+void updateSoftClock() {
+  unsigned long currentMillis = millis();
+  unsigned long elapsed = currentMillis - rtcLastMillis;
+  rtcLastMillis = currentMillis;
+  
+  // Korekcia driftu: zvyšok pod 1 ms sa prenáša do ďalšieho volania
+  rtcDriftAccum += (long)elapsed * rtcDriftPpm;
+  long correction = rtcDriftAccum / 1000000L;
+  rtcDriftAccum -= correction * 1000000L;
+  
+  rtcMillisAccum += (long)elapsed + correction;
+  if (rtcMillisAccum >= 1000) {
+    unsigned long seconds = rtcMillisAccum / 1000;
+    rtcMillisAccum -= seconds * 1000;
+    rtcWeekSeconds = (rtcWeekSeconds + seconds) % SECONDS_PER_WEEK;
+  }
+}
+
+void setSoftClock(int day, int hour, int minute) {
+  rtcWeekSeconds = day * 86400UL + hour * 3600UL + minute * 60UL;
+  rtcMillisAccum = 0;
+  rtcDriftAccum = 0;
+  rtcSet = true;
+  
+  // Rozpracovaný slot patrí k starému času - zahoď ho; aktuálna hodina je sledovaná
+  // len čiastočne, preto sa na jej konci tiež nezapíše
+  demandSlot = -1;
+  demandSlotDraws = 0;
+  demandSlotPartial = true;
+}
+
+void printSoftClock() {
+  static const char days[] PROGMEM = "PonUtoStrStvPiaSobNed";
+  unsigned long daySeconds = rtcWeekSeconds % 86400UL;
+  int hour = daySeconds / 3600;
+  int minute = (daySeconds / 60) % 60;
+  
+  const char* day = days + (rtcWeekSeconds / 86400UL) * 3;
+  for (byte i = 0; i < 3; i++) {
+    Serial.print((char)pgm_read_byte(day + i));
+  }
+  Serial.print(' ');
+  if (hour < 10) Serial.print('0');
+  Serial.print(hour);
+  Serial.print(':');
+  if (minute < 10) Serial.print('0');
+  Serial.print(minute);
+}
+
+// ========== Profil odberu ========== 
+
+// Na konci hodiny zapíše slot: stará hodnota sa utlmí o 1/8 a pripočítajú sa odbery.
+// Každý bajt v EEPROM sa tak zapisuje najviac raz za týždeň. Hodnota 0 je vyhradená
+// pre slot bez histórie, preto sa naučený slot nikdy neutlmí pod 1.
+void updateDemandLearning() {
+  if (!rtcSet) return;
+  
+  int slot = rtcWeekSeconds / 3600;
+  if (slot == demandSlot) return;
+  
+  if (demandSlot >= 0) {
+    if (!demandSlotPartial) {
+      byte old = demandHistogram[demandSlot];
+      unsigned int value = old - (old >> 3) + (unsigned int)demandSlotDraws * DEMAND_DRAW_WEIGHT;
+      if (value > 255) value = 255;
+      if (value == DEMAND_UNVISITED) value = 1;
+      demandHistogram[demandSlot] = value;
+      EEPROM.update(EEPROM_ADDR_DEMAND + demandSlot, value);
+    }
+    demandSlotPartial = false;
+  }
+  
+  demandSlot = slot;
+  demandSlotDraws = 0;
+}
+
+// Predohrev pred očakávaným odberom, znížená cieľová teplota v tichých obdobiach
+void updateDemandSchedule() {
+  if (!rtcSet) {
+    scheduledDestTemperature = destinationTemperature;
+    preheatActive = false;
+    preheatHeating = false;
+    return;
+  }
+  
+  int slot = rtcWeekSeconds / 3600;
+  byte nowDemand = demandHistogram[slot];
+  byte nextDemand = demandHistogram[(slot + 1) % DEMAND_SLOTS];
+  unsigned long slotRemaining = 3600 - rtcWeekSeconds % 3600;
+  
+  bool preheat = nowDemand >= DEMAND_PREHEAT_LEVEL ||
+                 (nextDemand >= DEMAND_PREHEAT_LEVEL && slotRemaining <= PREHEAT_LEAD_SECONDS);
+  // Zníženie len ak oba sloty už majú históriu - nenaučený profil nie je tichý
+  bool quiet = nowDemand != DEMAND_UNVISITED && nextDemand != DEMAND_UNVISITED &&
+               nowDemand < DEMAND_QUIET_LEVEL && nextDemand < DEMAND_QUIET_LEVEL;
+  
+  if (!preheat && quiet) {
+    scheduledDestTemperature = destinationTemperature - QUIET_SETBACK;
+    if (scheduledDestTemperature < 1) scheduledDestTemperature = 1;
+  } else {
+    scheduledDestTemperature = destinationTemperature;
+  }
+  
+  if (preheat && !preheatActive && currentMode == AUTOMATIC) {
+    Serial.print(F("Predohrev: "));
+    printSoftClock();
+    Serial.println();
+  }
+  preheatActive = preheat;
+  
+  // Predohrev drží relé do cieľovej teploty a znova sa zapne až pod cieľ mínus hysterézia,
+  // aby šum senzora pri cieli nespôsoboval rýchle prepínanie relé
+  if (!preheatActive || currentMode != AUTOMATIC || !ds18b20Available ||
+      tempOutput >= scheduledDestTemperature) {
+    preheatHeating = false;
+  } else if (tempOutput < scheduledDestTemperature - PREHEAT_HYSTERESIS) {
+    preheatHeating = true;
+  }
+}
+
+// Automatický režim: ON interval sa preskočí, kým má voda cieľovú teplotu
+// (bez nastavených hodín je plánovaná teplota rovná destinationTemperature)
+bool scheduledSetpointReached() {
+  return currentMode == AUTOMATIC && ds18b20Available &&
+         tempOutput >= scheduledDestTemperature;
+}
+
+// ========== Sériové príkazy ========== 
+
+void printDrawSettings() {
+  Serial.print(F("odber: "));
+  Serial.print(drawRateOn);
+  Serial.print('/');
+  Serial.print(drawRateOff);
+  Serial.print('/');
+  Serial.print(drawFilterAlpha);
+}
+
+// Načíta count celých čísel oddelených medzerami; false, ak chýbajú alebo za nimi nasleduje iný text
+bool parseSerialInts(const char* text, long* values, byte count) {
+  char* end;
+  for (byte i = 0; i < count; i++) {
+    values[i] = strtol(text, &end, 10);
+    if (end == text) return false;
+    text = end;
+  }
+  while (*text == ' ') text++;
+  return *text == '\0';
+}
+
+// T d hh mm  - nastav čas (d: 0 = pondelok ... 6 = nedeľa)
+// D ppm      - korekcia driftu hodín (+ = millis() meškajú)
+// O on off a - prahy detekcie odberu v stotinách (°C/s, °C/s, váha filtra)
+// S          - výpis stavu hodín, plánovača a prahov odberu
+void executeSerialCommand(char* command) {
+  long v[3];
+  
+  if (command[0] == 'T' && parseSerialInts(command + 1, v, 3) &&
+      v[0] >= 0 && v[0] <= 6 && v[1] >= 0 && v[1] <= 23 && v[2] >= 0 && v[2] <= 59) {
+    setSoftClock(v[0], v[1], v[2]);
+    Serial.print(F("Cas nastaveny: "));
+    printSoftClock();
+    Serial.println();
+  } else if (command[0] == 'D' && parseSerialInts(command + 1, v, 1) &&
+             v[0] >= -RTC_DRIFT_LIMIT && v[0] <= RTC_DRIFT_LIMIT) {
+    rtcDriftPpm = v[0];
+    saveDriftToEEPROM();
+    Serial.print(F("Drift: "));
+    Serial.print(rtcDriftPpm);
+    Serial.println(F(" ppm"));
+  } else if (command[0] == 'O' && parseSerialInts(command + 1, v, 3) &&
+      drawSettingsValid(v[0], v[1], v[2])) {
+    drawRateOn = v[0];
+    drawRateOff = v[1];
+    drawFilterAlpha = v[2];
+    saveDrawSettingsToEEPROM();
+    printDrawSettings();
+    Serial.println();
+  } else if (command[0] == 'S') {
+    if (rtcSet) {
+      printSoftClock();
+      Serial.print(F(" | profil: "));
+      Serial.print(demandHistogram[rtcWeekSeconds / 3600]);
+    } else {
+      Serial.print(F("Cas nenastaveny"));
+    }
+    Serial.print(F(" | drift: "));
+    Serial.print(rtcDriftPpm);
+    Serial.print(F(" ppm | "));
+    printDrawSettings();
+    Serial.print(F(" | ciel: "));
+    Serial.print(scheduledDestTemperature);
+    Serial.println(preheatActive ? F(" C (predohrev)") : F(" C"));
+  } else {
+    Serial.println(F("Neznamy prikaz (T d hh mm | D ppm | O on off a | S)"));
+  }
+}
+
+void handleSerialCommands() {
+  while (Serial.available() > 0) {
+    char c = Serial.read();
+    if (c == '\n' || c == '\r') {
+      if (serialLength > 0) {
+        serialBuffer[serialLength] = '\0';
+        executeSerialCommand(serialBuffer);
+        serialLength = 0;
+      }
+    } else if (serialLength < sizeof(serialBuffer) - 1) {
+      serialBuffer[serialLength++] = c;
+    }
+  }
 }
 
 Button readButton() {
@@ -275,8 +645,10 @@ void setup() {
   delay(2000);
   
   loadFromEEPROM();
+  loadDemandProfile();
   
   startTime = millis();
+  rtcLastMillis = startTime;
 }
 
 void displayNormalMode() {
@@ -632,10 +1004,36 @@ void controlRelay() {
   }
   
   unsigned long currentMillis = millis();
+  
+  // Control law:
+  //  - hot-water draw in progress -> relay held ON
+  //  - automatic mode, preheat window: relay held ON from (setpoint - PREHEAT_HYSTERESIS) up to the setpoint
+  //  - otherwise ON/OFF intervals; in automatic mode OFF->ON is skipped while the outlet is at the setpoint
+  bool holdOn = heatHoldRequested();
+  if (holdOn && !relayState) {
+    previousMillis = currentMillis;
+    relayState = true;
+    digitalWrite(LED_PIN, HIGH);
+    if (!simulationEnabled) {
+      digitalWrite(RELAY_PIN, LOW); // LOW = relay ON
+    }
+    Serial.println(F("Okamzity ohrev"));
+  }
+  
+  // The ON interval restarts while the hold lasts, so a full ON interval follows the end of the hold
+  if (holdOn) {
+    previousMillis = currentMillis;
+    return;
+  }
+  
   unsigned long interval = relayState ? (onIntervalSeconds * 1000) : (offIntervalSeconds * 1000);
   
   if (currentMillis - previousMillis >= interval) {
     previousMillis = currentMillis;
+    
+    // Water already at the scheduled setpoint - restart the OFF interval instead of heating
+    if (!relayState && scheduledSetpointReached()) return;
+    
     relayState = !relayState;
     
     // Update LED in all modes
@@ -666,6 +1064,10 @@ void readDHTSensor() {
 }
 
 void loop() {
+  handleSerialCommands();
+  updateSoftClock();
+  updateDemandLearning();
+  updateDemandSchedule();
   checkEmergencyButton();
   handleButtons();
   controlRelay();